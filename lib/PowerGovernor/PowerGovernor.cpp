@@ -0,0 +1,200 @@
+#include "PowerGovernor.h"
+
+PowerGovernor::PowerGovernor(const Config &config) : config(config) {}
+
+void PowerGovernor::setDuty(uint8_t channel, uint16_t value, uint32_t now) {
+    if (channel >= GOVERNOR_CHANNELS) {
+        return;
+    }
+
+    accumulate(now);
+    duty[channel] = value;
+}
+
+uint16_t PowerGovernor::getDuty(uint8_t channel) const {
+    if (channel >= GOVERNOR_CHANNELS) {
+        return 0;
+    }
+
+    return duty[channel];
+}
+
+uint16_t PowerGovernor::scale(uint16_t value) const {
+    return (uint32_t) value * cap / GOVERNOR_MAX_CAP;
+}
+
+bool PowerGovernor::update(uint16_t voltage, uint32_t now) {
+    const bool first = !hasReading;
+
+    if (first) {
+        hasReading = true;
+        startTime = now;
+        lastUpdate = now;
+        lastChange = now;
+        averageCurrent = requestedCurrent();
+    } else {
+        accumulate(now);
+
+        // Time-weighted so strobing colors don't make the load depend on when the sample was taken
+        const uint32_t elapsed = now - lastUpdate;
+
+        if (elapsed > 0) {
+            averageCurrent = dutyTime * config.channelCurrent / config.maxDuty / elapsed;
+        } else {
+            averageCurrent = requestedCurrent();
+        }
+
+        dutyTime = 0;
+        lastUpdate = now;
+    }
+
+    // Sag of the load this reading was taken under, cap hasn't moved since
+    const uint16_t restingVoltage = voltage + getLoadCurrent() * config.resistance / 1000;
+
+    if (first) {
+        filtered = (uint32_t) voltage << config.filterShift;
+        resting = (uint32_t) restingVoltage << config.filterShift;
+    } else {
+        // filtered += voltage - filtered / 2^shift, kept scaled to avoid losing precision
+        filtered = filtered - (filtered >> config.filterShift) + voltage;
+        resting = resting - (resting >> config.filterShift) + restingVoltage;
+    }
+
+    // Whichever is lower, so a sudden sag under a new load is acted on without waiting for the filter
+    uint8_t target = voltageCap(voltage < getVoltage() ? voltage : getVoltage());
+    uint8_t limit = runtimeCap(now);
+
+    if (limit < target) {
+        target = limit;
+    }
+
+    if (target < config.minCap) {
+        target = config.minCap;
+    }
+
+    const uint8_t previous = cap;
+
+    // Ramp up slowly so brightness doesn't visibly jump, but back off fast to avoid brownouts
+    if (target > cap) {
+        cap = target - cap > config.capStep ? cap + config.capStep : target;
+    } else if (target < cap) {
+        if (voltage <= config.minVoltage || cap - target <= config.capDropStep) {
+            cap = target;
+        } else {
+            cap -= config.capDropStep;
+        }
+    }
+
+    runtime = estimateRuntime();
+
+    return cap != previous;
+}
+
+uint8_t PowerGovernor::getCap() const {
+    return cap;
+}
+
+uint16_t PowerGovernor::getVoltage() const {
+    return filtered >> config.filterShift;
+}
+
+uint16_t PowerGovernor::getRestingVoltage() const {
+    return resting >> config.filterShift;
+}
+
+uint32_t PowerGovernor::getLoadCurrent() const {
+    return averageCurrent * cap / GOVERNOR_MAX_CAP + config.idleCurrent;
+}
+
+uint16_t PowerGovernor::getRuntime() const {
+    return runtime;
+}
+
+void PowerGovernor::accumulate(uint32_t now) {
+    if (hasReading) {
+        uint32_t sum = 0;
+
+        for (auto value : duty) {
+            sum += value;
+        }
+
+        dutyTime += (uint64_t) sum * (now - lastChange);
+    }
+
+    lastChange = now;
+}
+
+uint32_t PowerGovernor::requestedCurrent() const {
+    uint32_t sum = 0;
+
+    for (auto value : duty) {
+        sum += value;
+    }
+
+    return sum * config.channelCurrent / config.maxDuty;
+}
+
+uint32_t PowerGovernor::remainingCapacity() const {
+    const uint16_t voltage = getRestingVoltage();
+
+    if (voltage <= config.batteryLow) {
+        return 0;
+    }
+
+    if (voltage >= config.batteryHigh) {
+        return config.capacity;
+    }
+
+    return (uint32_t) config.capacity * (voltage - config.batteryLow) / (config.batteryHigh - config.batteryLow);
+}
+
+// Loaded voltage on purpose: this is what browns the unit out
+uint8_t PowerGovernor::voltageCap(uint16_t voltage) const {
+    if (voltage >= config.softVoltage) {
+        return GOVERNOR_MAX_CAP;
+    }
+
+    if (voltage <= config.minVoltage) {
+        return config.minCap;
+    }
+
+    return config.minCap + (uint32_t) (GOVERNOR_MAX_CAP - config.minCap) * (voltage - config.minVoltage) /
+                           (config.softVoltage - config.minVoltage);
+}
+
+uint8_t PowerGovernor::runtimeCap(uint32_t now) const {
+    if (config.targetRuntime == 0 || averageCurrent == 0) {
+        return GOVERNOR_MAX_CAP;
+    }
+
+    const uint32_t budget = (uint32_t) config.targetRuntime * 60000;
+    const uint32_t elapsed = now - startTime;
+
+    // Target reached, only voltage limits from now on
+    if (elapsed >= budget) {
+        return GOVERNOR_MAX_CAP;
+    }
+
+    // Average current that drains what is left exactly at target runtime
+    const uint64_t allowed = (uint64_t) remainingCapacity() * 3600000 / (budget - elapsed);
+
+    if (allowed <= config.idleCurrent) {
+        return 0;
+    }
+
+    const uint64_t limit = (allowed - config.idleCurrent) * GOVERNOR_MAX_CAP / averageCurrent;
+
+    return limit > GOVERNOR_MAX_CAP ? GOVERNOR_MAX_CAP : limit;
+}
+
+uint16_t PowerGovernor::estimateRuntime() const {
+    const uint32_t current = getLoadCurrent();
+
+    if (current == 0) {
+        return GOVERNOR_RUNTIME_UNKNOWN;
+    }
+
+    const uint32_t minutes = remainingCapacity() * 60 / current;
+
+    return minutes >= GOVERNOR_RUNTIME_UNKNOWN ? GOVERNOR_RUNTIME_UNKNOWN - 1 : minutes;
+}
@@ -0,0 +1,86 @@
+#ifndef RGB_ESP32_POWER_GOVERNOR_H
+#define RGB_ESP32_POWER_GOVERNOR_H
+
+#include <stdint.h>
+
+#define GOVERNOR_CHANNELS 3
+#define GOVERNOR_MAX_CAP 255
+#define GOVERNOR_RUNTIME_UNKNOWN 0xFFFF
+
+// Battery-aware brightness limiter. Has no Arduino dependencies so it can be
+// fed simulated discharge curves on the host. Voltages are raw ADC readings,
+// same units as BATTERY_LOW / BATTERY_HIGH, times are milliseconds.
+class PowerGovernor {
+public:
+    struct Config {
+        uint16_t batteryLow;        // empty pack
+        uint16_t batteryHigh;       // full pack
+        uint16_t capacity;          // mAh
+        uint16_t channelCurrent;    // mA drawn by one channel at full duty
+        uint16_t idleCurrent;       // mA drawn with LEDs off
+        uint16_t maxDuty;
+        uint16_t resistance;        // pack sag, ADC counts per A of load
+        uint16_t targetRuntime;     // minutes since first reading, 0 disables runtime limiting
+        uint16_t softVoltage;       // cap starts to drop below this
+        uint16_t minVoltage;        // cap reaches minCap here
+        uint8_t minCap;
+        uint8_t capStep;            // max cap increase per update()
+        uint8_t capDropStep;        // max cap decrease per update(), unlimited once reading hits minVoltage
+        uint8_t filterShift;        // EMA weight is 1 / 2^filterShift
+    };
+
+    explicit PowerGovernor(const Config &config);
+
+    // Remembers requested (uncapped) duty of the channel
+    void setDuty(uint8_t channel, uint16_t duty, uint32_t now);
+
+    uint16_t getDuty(uint8_t channel) const;
+
+    // Requested duty with current cap applied
+    uint16_t scale(uint16_t duty) const;
+
+    // Feeds a new battery reading, returns true if cap has changed
+    bool update(uint16_t voltage, uint32_t now);
+
+    uint8_t getCap() const;
+
+    // Filtered voltage as measured, under load
+    uint16_t getVoltage() const;
+
+    // Filtered voltage with sag of each reading's load added back
+    uint16_t getRestingVoltage() const;
+
+    // Average LED + idle current since previous update() at current cap, mA
+    uint32_t getLoadCurrent() const;
+
+    // Estimated remaining runtime at current load, minutes
+    uint16_t getRuntime() const;
+
+protected:
+    Config config;
+    uint16_t duty[GOVERNOR_CHANNELS] = {0, 0, 0};
+    uint32_t filtered = 0;  // loaded voltage << filterShift
+    uint32_t resting = 0;   // voltage with sag added back << filterShift
+    bool hasReading = false;
+    uint32_t startTime = 0;
+    uint32_t lastUpdate = 0;
+    uint32_t lastChange = 0;
+    uint64_t dutyTime = 0;  // sum of duties * ms since previous update()
+    uint32_t averageCurrent = 0;
+    uint8_t cap = GOVERNOR_MAX_CAP;
+    uint16_t runtime = GOVERNOR_RUNTIME_UNKNOWN;
+
+    void accumulate(uint32_t now);
+
+    uint32_t requestedCurrent() const;
+
+    uint32_t remainingCapacity() const;
+
+    uint8_t voltageCap(uint16_t voltage) const;
+
+    uint8_t runtimeCap(uint32_t now) const;
+
+    uint16_t estimateRuntime() const;
+};
+
+#endif //RGB_ESP32_POWER_GOVERNOR_H
@@ -16,6 +16,7 @@
 #define TURN_ON_CHARACTERISTIC "c9af1949-4275-46ec-9d63-f01fe45e9477"
 #define SPEED_CHARACTERISTIC "74d51f60-ed42-4f82-b189-0fab7ffa7cd9"
 #define RAINBOW_BRIGHTNESS_CHARACTERISTIC "a17d62aa-0b5f-462c-af21-14d6085bbc4b"
+#define RUNTIME_CHARACTERISTIC "6b3c0f8e-3d1a-4c52-9b7e-2f4a8d91c5e6"
 
 #define BATTERY_SERVICE (uint16_t) 0x180F
 #define BATTERY_CHARACTERISTIC (uint16_t) 0x2A19
@@ -36,6 +37,19 @@
 // 2581 = ?? = 8.7v
 // 3675 = 2.95 = 11.96v
 
+#define BATTERY_CAPACITY 2200           // mAh
+#define CHANNEL_CURRENT 1000            // mA per channel at MAX_COLOR_VALUE
+#define IDLE_CURRENT 80                 // mA, ESP32 + BLE with LEDs off
+#define BATTERY_RESISTANCE 46           // ADC counts per A, ~0.15 Ohm * ~307 counts/V
+
+#define GOVERNOR_TARGET_RUNTIME 0       // minutes since power-on, 0 = only limit by voltage
+#define GOVERNOR_SOFT_VOLTAGE 3000      // start dimming below this
+#define GOVERNOR_MIN_VOLTAGE 2850       // fully dimmed to GOVERNOR_MIN_CAP here
+#define GOVERNOR_MIN_CAP 25             // of 255
+#define GOVERNOR_CAP_STEP 16            // max cap increase per battery reading
+#define GOVERNOR_CAP_DROP_STEP 128      // max cap decrease per battery reading
+#define GOVERNOR_FILTER_SHIFT 2         // voltage EMA weight = 1/4
+
 #define OTA_PASSWORD "12345678"
 
 #endif //RGB_ESP32_CONFIG_H
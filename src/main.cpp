@@ -6,6 +6,7 @@
 #include <WiFi.h>
 #include <ArduinoOTA.h>
 #include <Preferences.h>
+#include <PowerGovernor.h>
 #include <config.h>
 
 typedef enum {
@@ -22,12 +23,30 @@ BLECharacteristic *color2Characteristic = nullptr;
 BLECharacteristic *turnOnCharacteristic = nullptr;
 BLECharacteristic *speedCharacteristic = nullptr;
 BLECharacteristic *rainbowBrightnessCharacteristic = nullptr;
+BLECharacteristic *runtimeCharacteristic = nullptr;
 
 BLECharacteristic *otaCharacteristic = nullptr;
 
 Ticker batteryTicker;
 Ticker saveTicker;
 Preferences preferences;
+SemaphoreHandle_t ledMutex = nullptr;
+PowerGovernor governor({
+        BATTERY_LOW,
+        BATTERY_HIGH,
+        BATTERY_CAPACITY,
+        CHANNEL_CURRENT,
+        IDLE_CURRENT,
+        MAX_COLOR_VALUE,
+        BATTERY_RESISTANCE,
+        GOVERNOR_TARGET_RUNTIME,
+        GOVERNOR_SOFT_VOLTAGE,
+        GOVERNOR_MIN_VOLTAGE,
+        GOVERNOR_MIN_CAP,
+        GOVERNOR_CAP_STEP,
+        GOVERNOR_CAP_DROP_STEP,
+        GOVERNOR_FILTER_SHIFT,
+});
 
 uint8_t mode = STATIC;
 uint16_t color[] = {MAX_COLOR_VALUE, 0, 0};
@@ -37,12 +56,15 @@ uint8_t speed = 100;
 uint8_t ota = 0;
 uint8_t batteryLevel = 0;
 uint8_t rainbowBrightness = 255;
+uint16_t runtime = GOVERNOR_RUNTIME_UNKNOWN;
 
 uint8_t currentFadingUp = 1;
 uint8_t currentFadingDown = 0;
 uint16_t maxRainbowColor = rainbowBrightness * MAX_COLOR_VALUE / 255;
 
 void setupLed() {
+    ledMutex = xSemaphoreCreateMutex();
+
     pinMode(RED_PIN, OUTPUT);
     pinMode(GREEN_PIN, OUTPUT);
     pinMode(BLUE_PIN, OUTPUT);
@@ -56,6 +78,28 @@ void setupLed() {
     ledcAttachPin(BLUE_PIN, BLUE_CHANNEL);
 }
 
+// Called from loop(), BLE callbacks and battery ticker, so governor and LED writes are serialized
+void writeLed(uint8_t channel, uint16_t value) {
+    xSemaphoreTake(ledMutex, portMAX_DELAY);
+
+    governor.setDuty(channel, value, millis());
+    ledcWrite(channel, governor.scale(value));
+
+    xSemaphoreGive(ledMutex);
+}
+
+void updateGovernor(uint16_t voltage) {
+    xSemaphoreTake(ledMutex, portMAX_DELAY);
+
+    if (governor.update(voltage, millis())) {
+        ledcWrite(RED_CHANNEL, governor.scale(governor.getDuty(RED_CHANNEL)));
+        ledcWrite(GREEN_CHANNEL, governor.scale(governor.getDuty(GREEN_CHANNEL)));
+        ledcWrite(BLUE_CHANNEL, governor.scale(governor.getDuty(BLUE_CHANNEL)));
+    }
+
+    xSemaphoreGive(ledMutex);
+}
+
 void savePreferences() {
     preferences.putUChar("mode", mode);
     preferences.putUChar("speed", speed);
@@ -112,6 +156,22 @@ void readBattery(bool useMedian = false) {
     Serial.print(battery);
     Serial.print("%, ");
     Serial.println(value);
+
+    updateGovernor(value);
+
+    if (runtime != governor.getRuntime()) {
+        runtime = governor.getRuntime();
+        runtimeCharacteristic->setValue((uint8_t *) &runtime, 2);
+        runtimeCharacteristic->notify();
+    }
+
+    Serial.print("Brightness cap: ");
+    Serial.print(governor.getCap());
+    Serial.print(", load: ");
+    Serial.print(governor.getLoadCurrent());
+    Serial.print("mA, runtime: ");
+    Serial.print(runtime);
+    Serial.println("min");
 }
 
 void setupBattery() {
@@ -189,9 +249,9 @@ public:
         color[1] = data[1];
         color[2] = data[2];
 
-        ledcWrite(RED_CHANNEL, color[0]);
-        ledcWrite(GREEN_CHANNEL, color[1]);
-        ledcWrite(BLUE_CHANNEL, color[2]);
+        writeLed(RED_CHANNEL, color[0]);
+        writeLed(GREEN_CHANNEL, color[1]);
+        writeLed(BLUE_CHANNEL, color[2]);
 
         if (turnOn != 1) {
             turnOn = 1;
@@ -248,15 +308,15 @@ public:
         pCharacteristic->notify();
 
         if (turnOn == 1) {
-            ledcWrite(RED_CHANNEL, color[0]);
-            ledcWrite(GREEN_CHANNEL, color[1]);
-            ledcWrite(BLUE_CHANNEL, color[2]);
+            writeLed(RED_CHANNEL, color[0]);
+            writeLed(GREEN_CHANNEL, color[1]);
+            writeLed(BLUE_CHANNEL, color[2]);
 
             Serial.println("Turned on");
         } else {
-            ledcWrite(RED_CHANNEL, 0);
-            ledcWrite(GREEN_CHANNEL, 0);
-            ledcWrite(BLUE_CHANNEL, 0);
+            writeLed(RED_CHANNEL, 0);
+            writeLed(GREEN_CHANNEL, 0);
+            writeLed(BLUE_CHANNEL, 0);
 
             Serial.println("Turned off");
         }
@@ -391,9 +451,9 @@ void setupPreferences() {
     color2[1] = preferences.getUShort("green2", color2[1]);
     color2[2] = preferences.getUShort("blue2", color2[2]);
 
-    ledcWrite(RED_CHANNEL, color[0]);
-    ledcWrite(GREEN_CHANNEL, color[1]);
-    ledcWrite(BLUE_CHANNEL, color[2]);
+    writeLed(RED_CHANNEL, color[0]);
+    writeLed(GREEN_CHANNEL, color[1]);
+    writeLed(BLUE_CHANNEL, color[2]);
 
     Serial.print("Loaded Color1: ");
     Serial.print(color[0]);
@@ -507,6 +567,14 @@ void setupBLE() {
     rainbowBrightnessCharacteristic->setCallbacks(new RainbowBrightnessCharacteristicCallbacks());
 //    speedCharacteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM);
 
+    runtimeCharacteristic = mainService->createCharacteristic(
+            RUNTIME_CHARACTERISTIC,
+            BLECharacteristic::PROPERTY_READ |
+            BLECharacteristic::PROPERTY_NOTIFY
+    );
+    runtimeCharacteristic->addDescriptor(new BLE2902());
+    runtimeCharacteristic->setValue((uint8_t *) &runtime, 2);
+
     mainService->start();
 
     auto otaService = server->createService(OTA_SERVICE);
@@ -577,9 +645,9 @@ void loop() {
                     currentFadingDown = (currentFadingDown + 1) % 3;
                 }
 
-                ledcWrite(RED_CHANNEL, color[0] * rainbowBrightness / 255);
-                ledcWrite(GREEN_CHANNEL, color[1] * rainbowBrightness / 255);
-                ledcWrite(BLUE_CHANNEL, color[2] * rainbowBrightness / 255 );
+                writeLed(RED_CHANNEL, color[0] * rainbowBrightness / 255);
+                writeLed(GREEN_CHANNEL, color[1] * rainbowBrightness / 255);
+                writeLed(BLUE_CHANNEL, color[2] * rainbowBrightness / 255 );
 
                 Serial.print("Rainbow color ");
                 Serial.print(color[0]);
@@ -600,15 +668,15 @@ void loop() {
                 lastTime = time;
 
                 if (strobeCurrentColor == 0) {
-                    ledcWrite(RED_CHANNEL, color[0]);
-                    ledcWrite(GREEN_CHANNEL, color[1]);
-                    ledcWrite(BLUE_CHANNEL, color[2]);
+                    writeLed(RED_CHANNEL, color[0]);
+                    writeLed(GREEN_CHANNEL, color[1]);
+                    writeLed(BLUE_CHANNEL, color[2]);
 
                     strobeCurrentColor = 1;
                 } else {
-                    ledcWrite(RED_CHANNEL, color2[0]);
-                    ledcWrite(GREEN_CHANNEL, color2[1]);
-                    ledcWrite(BLUE_CHANNEL, color2[2]);
+                    writeLed(RED_CHANNEL, color2[0]);
+                    writeLed(GREEN_CHANNEL, color2[1]);
+                    writeLed(BLUE_CHANNEL, color2[2]);
 
                     strobeCurrentColor = 0;
                 }
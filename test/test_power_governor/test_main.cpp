@@ -0,0 +1,322 @@
+#include <unity.h>
+#include <PowerGovernor.h>
+
+#define SECOND 1000
+#define MINUTE 60000
+
+PowerGovernor::Config makeConfig() {
+    return {
+            2800,   // batteryLow
+            3700,   // batteryHigh
+            2200,   // capacity
+            1000,   // channelCurrent
+            80,     // idleCurrent
+            4095,   // maxDuty
+            0,      // resistance
+            0,      // targetRuntime
+            3000,   // softVoltage
+            2850,   // minVoltage
+            25,     // minCap
+            16,     // capStep
+            128,    // capDropStep
+            2,      // filterShift
+    };
+}
+
+void setWhite(PowerGovernor &governor, uint16_t value, uint32_t now) {
+    for (uint8_t channel = 0; channel < GOVERNOR_CHANNELS; channel++) {
+        governor.setDuty(channel, value, now);
+    }
+}
+
+// Current drawn until the next reading, with duties and cap as they are now
+uint32_t whiteLoad(const PowerGovernor::Config &config, const PowerGovernor &governor) {
+    uint32_t sum = 0;
+
+    for (uint8_t channel = 0; channel < GOVERNOR_CHANNELS; channel++) {
+        sum += governor.scale(governor.getDuty(channel));
+    }
+
+    return sum * config.channelCurrent / config.maxDuty + config.idleCurrent;
+}
+
+// Resting voltage of a pack with linear discharge curve
+uint16_t packVoltage(const PowerGovernor::Config &config, double remaining) {
+    return config.batteryLow + (config.batteryHigh - config.batteryLow) * remaining / config.capacity;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_filter_seeds_from_first_reading() {
+    PowerGovernor governor(makeConfig());
+
+    governor.update(3300, 0);
+    TEST_ASSERT_EQUAL_UINT16(3300, governor.getVoltage());
+
+    // 3300 + (3100 - 3300) / 4
+    governor.update(3100, 2 * SECOND);
+    TEST_ASSERT_EQUAL_UINT16(3250, governor.getVoltage());
+}
+
+void test_cap_full_above_soft_voltage() {
+    PowerGovernor governor(makeConfig());
+    setWhite(governor, 4095, 0);
+
+    for (uint32_t i = 0; i < 20; i++) {
+        governor.update(3001 + i * 30, i * 20 * SECOND);
+        TEST_ASSERT_EQUAL_UINT8(255, governor.getCap());
+        TEST_ASSERT_EQUAL_UINT16(4095, governor.scale(4095));
+    }
+}
+
+void test_cap_ramps_linearly_to_min_voltage() {
+    auto config = makeConfig();
+    config.filterShift = 0;
+    config.capStep = 255;
+
+    const uint16_t voltages[] = {3000, 2925, 2850, 2800};
+    const uint8_t caps[] = {255, 140, 25, 25};
+
+    for (uint8_t i = 0; i < 4; i++) {
+        PowerGovernor governor(config);
+        setWhite(governor, 4095, 0);
+
+        governor.update(voltages[i], 0);
+        TEST_ASSERT_EQUAL_UINT8(caps[i], governor.getCap());
+    }
+}
+
+void test_cap_changes_at_most_step_per_reading() {
+    auto config = makeConfig();
+    config.filterShift = 0;
+    config.capDropStep = 32;
+
+    PowerGovernor governor(config);
+    setWhite(governor, 4095, 0);
+    governor.update(3300, 0);
+
+    uint8_t previous = governor.getCap();
+
+    // Above minVoltage, so drop is step limited
+    for (uint32_t i = 1; i < 30; i++) {
+        governor.update(2851, i * 20 * SECOND);
+
+        TEST_ASSERT_LESS_OR_EQUAL_UINT8(config.capDropStep, previous - governor.getCap());
+        previous = governor.getCap();
+    }
+
+    TEST_ASSERT_EQUAL_UINT8(26, governor.getCap());
+
+    for (uint32_t i = 30; i < 60; i++) {
+        governor.update(3300, i * 20 * SECOND);
+
+        TEST_ASSERT_LESS_OR_EQUAL_UINT8(config.capStep, governor.getCap() - previous);
+        previous = governor.getCap();
+    }
+
+    TEST_ASSERT_EQUAL_UINT8(255, governor.getCap());
+}
+
+void test_cap_drops_fast_on_load_step_at_low_voltage() {
+    auto config = makeConfig();
+    config.resistance = 46;
+
+    PowerGovernor governor(config);
+    uint32_t now = 0;
+
+    // LEDs off, pack resting just above the soft threshold
+    for (; now < 2 * MINUTE; now += 20 * SECOND) {
+        governor.update(3010 - whiteLoad(config, governor) * config.resistance / 1000, now);
+    }
+
+    TEST_ASSERT_EQUAL_UINT8(255, governor.getCap());
+
+    setWhite(governor, 4095, now);
+    uint8_t readings = 0;
+
+    // Full white at full cap sags the pack to ~2869, cap settles around 145
+    while (governor.getCap() > 160 && readings < 10) {
+        now += 20 * SECOND;
+        governor.update(3010 - whiteLoad(config, governor) * config.resistance / 1000, now);
+        readings++;
+    }
+
+    TEST_ASSERT_LESS_OR_EQUAL_UINT8(1, readings);
+
+    // Cap then settles where loaded voltage and cap agree, not at minCap
+    for (uint8_t i = 0; i < 30; i++) {
+        now += 20 * SECOND;
+        governor.update(3010 - whiteLoad(config, governor) * config.resistance / 1000, now);
+    }
+
+    TEST_ASSERT_UINT16_WITHIN(3, 3010, governor.getRestingVoltage());
+    TEST_ASSERT_GREATER_THAN_UINT8(config.minCap, governor.getCap());
+}
+
+void test_cap_drops_to_floor_below_min_voltage() {
+    auto config = makeConfig();
+    config.capDropStep = 16;
+
+    PowerGovernor governor(config);
+    setWhite(governor, 4095, 0);
+    governor.update(3300, 0);
+    governor.update(2800, 20 * SECOND);
+
+    TEST_ASSERT_EQUAL_UINT8(config.minCap, governor.getCap());
+}
+
+void test_runtime_decreases_while_discharging() {
+    auto config = makeConfig();
+    config.softVoltage = config.batteryLow;
+    config.minVoltage = config.batteryLow;
+
+    PowerGovernor governor(config);
+    setWhite(governor, 2048, 0);
+
+    double remaining = config.capacity;
+    uint16_t previous = GOVERNOR_RUNTIME_UNKNOWN;
+
+    for (uint32_t now = 0; remaining > 0; now += 20 * SECOND) {
+        governor.update(packVoltage(config, remaining), now);
+
+        TEST_ASSERT_LESS_OR_EQUAL_UINT16(previous, governor.getRuntime());
+        previous = governor.getRuntime();
+
+        remaining -= governor.getLoadCurrent() * 20.0 / 3600;
+    }
+
+    TEST_ASSERT_LESS_OR_EQUAL_UINT16(1, previous);
+}
+
+void test_runtime_unknown_at_zero_load() {
+    auto config = makeConfig();
+    config.idleCurrent = 0;
+
+    PowerGovernor governor(config);
+    governor.update(3300, 0);
+    governor.update(3300, 20 * SECOND);
+
+    TEST_ASSERT_EQUAL_UINT32(0, governor.getLoadCurrent());
+    TEST_ASSERT_EQUAL_UINT16(GOVERNOR_RUNTIME_UNKNOWN, governor.getRuntime());
+}
+
+void test_runtime_cap_holds_target_runtime() {
+    auto config = makeConfig();
+    config.targetRuntime = 120;
+    config.softVoltage = config.batteryLow;
+    config.minVoltage = config.batteryLow;
+    config.minCap = 0;
+
+    PowerGovernor governor(config);
+    setWhite(governor, 4095, 0);
+
+    double remaining = config.capacity;
+    uint32_t now = 0;
+
+    // Full white draws ~3 A, which would empty the pack in ~43 minutes
+    for (; remaining > 0 && now < 240 * MINUTE; now += 20 * SECOND) {
+        governor.update(packVoltage(config, remaining), now);
+
+        // Skip the initial ramp down, and the end where filter lag is large relative to what is left
+        if (now > 10 * MINUTE && now < 90 * MINUTE) {
+            const uint32_t budget = remaining * 60 / ((120 * MINUTE - now) / (double) MINUTE);
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(budget * 105 / 100, governor.getLoadCurrent());
+        }
+
+        remaining -= governor.getLoadCurrent() * 20.0 / 3600;
+    }
+
+    TEST_ASSERT_UINT32_WITHIN(5 * MINUTE, 120 * MINUTE, now);
+}
+
+void test_strobe_load_is_time_weighted() {
+    PowerGovernor governor(makeConfig());
+    uint16_t runtimes[10];
+
+    for (uint32_t now = 0, reading = 0; reading < 10; now += 500) {
+        setWhite(governor, (now / 500) % 2 ? 4095 : 0, now);
+
+        if (now > 0 && now % (20 * SECOND) == 0) {
+            governor.update(3300, now);
+            runtimes[reading++] = governor.getRuntime();
+        }
+    }
+
+    // Half of full white + idle: 1500 + 80 mA
+    TEST_ASSERT_UINT32_WITHIN(20, 1580, governor.getLoadCurrent());
+
+    for (uint8_t i = 2; i < 10; i++) {
+        TEST_ASSERT_UINT16_WITHIN(1, runtimes[1], runtimes[i]);
+    }
+}
+
+void test_resting_voltage_compensates_sag() {
+    auto config = makeConfig();
+    config.resistance = 46;
+
+    PowerGovernor governor(config);
+    PowerGovernor ideal(makeConfig());
+    setWhite(governor, 4095, 0);
+    setWhite(ideal, 4095, 0);
+
+    for (uint32_t now = 0; now < 5 * MINUTE; now += 20 * SECOND) {
+        governor.update(3300 - governor.getLoadCurrent() * config.resistance / 1000, now);
+        ideal.update(3300, now);
+    }
+
+    TEST_ASSERT_UINT16_WITHIN(3, 3300, governor.getRestingVoltage());
+    TEST_ASSERT_UINT16_WITHIN(1, ideal.getRuntime(), governor.getRuntime());
+}
+
+void test_resting_voltage_follows_load_steps() {
+    auto config = makeConfig();
+    config.resistance = 46;
+
+    PowerGovernor governor(config);
+    uint32_t now = 0;
+
+    governor.update(3300 - whiteLoad(config, governor) * config.resistance / 1000, now);
+
+    const uint16_t steps[] = {4095, 0, 4095, 0};
+
+    for (auto value : steps) {
+        setWhite(governor, value, now);
+
+        uint16_t settled = 0;
+
+        for (uint8_t i = 0; i < 15; i++) {
+            now += 20 * SECOND;
+            governor.update(3300 - whiteLoad(config, governor) * config.resistance / 1000, now);
+
+            TEST_ASSERT_UINT16_WITHIN(3, 3300, governor.getRestingVoltage());
+
+            // Runtime is right from the first reading under the new load
+            if (i == 0) {
+                settled = governor.getRuntime();
+            } else {
+                TEST_ASSERT_UINT16_WITHIN(1, settled, governor.getRuntime());
+            }
+        }
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_filter_seeds_from_first_reading);
+    RUN_TEST(test_cap_full_above_soft_voltage);
+    RUN_TEST(test_cap_ramps_linearly_to_min_voltage);
+    RUN_TEST(test_cap_changes_at_most_step_per_reading);
+    RUN_TEST(test_cap_drops_fast_on_load_step_at_low_voltage);
+    RUN_TEST(test_cap_drops_to_floor_below_min_voltage);
+    RUN_TEST(test_runtime_decreases_while_discharging);
+    RUN_TEST(test_runtime_unknown_at_zero_load);
+    RUN_TEST(test_runtime_cap_holds_target_runtime);
+    RUN_TEST(test_strobe_load_is_time_weighted);
+    RUN_TEST(test_resting_voltage_compensates_sag);
+    RUN_TEST(test_resting_voltage_follows_load_steps);
+
+    return UNITY_END();
+}